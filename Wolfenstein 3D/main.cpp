@@ -13,6 +13,11 @@
 #include <stdio.h>
 #include <string>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <sys/resource.h>
 
 using namespace std;
 
@@ -24,6 +29,73 @@ public:
     float animationTime;
 };
 
+// Sound identifiers
+enum SoundId {
+    SOUND_DOOR_OPEN = 0,
+    SOUND_DOOR_CLOSE,
+    SOUNDS_COUNT
+};
+
+// Sound event types
+enum SoundEventType {
+    SOUND_EVENT_PLAY = 0,
+    SOUND_EVENT_STOP
+};
+
+// Sound event sent from the game thread to the mixer
+struct SoundEvent {
+public:
+    int type;
+    int sound;
+    int key;
+    float x;
+    float z;
+};
+
+// Single voice played by the mixer
+struct VoiceStruct {
+public:
+    bool active;
+    int sound;
+    int key;
+    int position;
+    float x;
+    float z;
+};
+
+// Lock-free ring buffer for one producer and one consumer thread
+template <typename T, unsigned int capacity>
+struct RingBuffer {
+public:
+    T items[capacity];
+    std::atomic<unsigned int> head;
+    std::atomic<unsigned int> tail;
+    
+    RingBuffer() : head(0), tail(0) {}
+    
+    // Called only by the producer
+    bool push(const T &item) {
+        unsigned int currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) >= capacity) {
+            return false;
+        }
+        items[currentTail % capacity] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+    
+    // Called only by the consumer
+    bool pop(T &item) {
+        unsigned int currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items[currentHead % capacity];
+        head.store(currentHead + 1, std::memory_order_release);
+        return true;
+    }
+};
+
 // End of game
 bool endOfGameFlag = false;
 
@@ -58,6 +130,29 @@ const float doorThickness = 0.07;
 const int screenWidth = 1200;
 const int screenHeight = 800;
 
+// Audio settings
+const int audioFrequency = 44100;
+const int audioBufferSize = 1024;
+const int audioVoicesCount = 32;
+const float audioRolloff = 0.5f;
+const float audioMaxDistance = 24.0f;
+
+// Generator settings
+const int generatorCellSize = 10;
+
+// Benchmark settings
+const int benchmarkFrames = 10;
+const int benchmarkTimeLimit = 5;
+
+// Overdraw counter settings
+const int overdrawQueriesCount = 2;
+
+// Capture settings
+const int captureBuffersCount = 3;
+const int captureFramesCount = 8;
+const int captureFrameSize = screenWidth * screenHeight * 4;
+const int goldenTolerance = 2;
+
 // SDL initialization
 bool initializeSDL();
 
@@ -76,6 +171,12 @@ void renderScene();
 // Exit SDL
 void exitSDL();
 
+// Draw map (from player's cell outwards or row by row)
+void drawMap();
+
+// Draw single cell of the map
+void drawCell(int x, int y);
+
 // Draw single wall
 void drawSigleWall(float x1, float y1, float x2, float y2);
 
@@ -118,53 +219,201 @@ SDL_Surface* trimTexture(SDL_Surface* texture, int x, int y, int width, int heig
 // Get pixel color from a texture
 Uint32 getPixelColor(SDL_Surface *texture, int x, int y);
 
+// Set pixel color in a texture
+void setPixelColor(SDL_Surface *texture, int x, int y, Uint32 color);
+
+// Map file (or size of generated map)
+char *mapFileName = (char *)"map.bmp";
+char *savedMapFileName = NULL;
+int generatedMapSize = 0;
+
+// Generator settings
+unsigned int generatorSeed = 1;
+unsigned int generatorState = 1;
+float roomDensity = 0.5f;
+float corridorDensity = 0.2f;
+float doorDensity = 0.5f;
+
+// Benchmark settings
+bool benchmarkMode = false;
+int benchmarkMaxSize = 16384;
+
+// Allocate map
+void allocateMap(int width, int height);
+
+// Release map
+void freeMap();
+
+// Read map from its picture
+void loadMap(SDL_Surface *mapFile);
+
+// Animate all doors
+void updateDoors();
+
+// Generate map picture
+SDL_Surface* generateMap(int width, int height);
+
+// Connect two rooms with corridor
+void connectRooms(SDL_Surface *mapFile, SDL_Rect a, SDL_Rect b, vector<SDL_Rect> &doors);
+
+// Check if point is inside a room
+bool insideRoom(SDL_Rect room, int x, int y);
+
+// Random number for generator
+unsigned int randomNumber();
+
+// Random number from 0 to 1 for generator
+float randomFloat();
+
+// Measure how map size affects the game
+void runBenchmark();
+
+// Peak memory used by the process in MB
+double peakMemoryUsage();
+
+// Audio device (0 when there is no sound)
+SDL_AudioDeviceID audioDevice = 0;
+
+// Generated sounds (mono samples)
+float *sounds[SOUNDS_COUNT];
+int soundLengths[SOUNDS_COUNT];
+
+// Events waiting for the mixer
+RingBuffer<SoundEvent, 256> soundEvents;
+int droppedSoundEvents = 0;
+
+// Player's position and camera as heard by the mixer
+std::atomic<float> listenerX(0.0f);
+std::atomic<float> listenerZ(0.0f);
+std::atomic<float> listenerAngle(0.0f);
+
+// Mixer state, touched only by the audio callback
+VoiceStruct voices[audioVoicesCount];
+Uint64 lastAudioCallback = 0;
+Uint64 audioCallbackPeriod = 0;
+int stolenVoices = 0;
+
+// Mixer statistics
+std::atomic<int> audioCallbacks(0);
+std::atomic<int> audioUnderruns(0);
+
+// Audio initialization
+bool initializeAudio();
+
+// Exit audio
+void exitAudio();
+
+// Generate door sounds
+void generateSounds();
+
+// Send event to the mixer
+void sendSoundEvent(int type, int sound, int key, float x, float z);
+
+// Mixer running in the audio callback
+void audioCallback(void *userdata, Uint8 *stream, int length);
+
+// Rendering options
+bool depthPrepass = false;
+bool depthOnlyPass = false;
+
+// Plain row by row drawing order, to compare with front-to-back one
+bool plainDrawingOrder = false;
+
+// Overdraw counter (fragments drawn per pixel in each pass)
+bool overdrawCounter = false;
+GLuint depthPassQueries[overdrawQueriesCount];
+GLuint colorPassQueries[overdrawQueriesCount];
+int overdrawFrames = 0;
+int collectedOverdrawFrames = 0;
+double depthPassSamples = 0.0;
+double colorPassSamples = 0.0;
+
+// Overdraw counter initialization
+void initializeOverdrawCounter();
+
+// Exit overdraw counter
+void exitOverdrawCounter();
+
+// Add result of finished query
+void collectOverdrawQuery(int id);
+
+// Exit code of the game
+int exitCode = 0;
+
+// Capture files (NULL when not used)
+char *captureFileName = NULL;
+char *goldenFileName = NULL;
+FILE *captureFile = NULL;
+
+// Pixel buffers read back asynchronously
+GLuint capturePixelBuffers[captureBuffersCount];
+int captureFrameNumber = 0;
+
+// Frames passed between renderer and encoder thread
+Uint8 *captureFrames[captureFramesCount];
+RingBuffer<int, captureFramesCount * 2> filledCaptureFrames;
+RingBuffer<int, captureFramesCount * 2> freeCaptureFrames;
+SDL_sem *captureSemaphore = NULL;
+SDL_Thread *captureThread = NULL;
+
+// Encoder buffers (one plane per component)
+Uint8 *capturePlanes = NULL;
+
+// Offscreen framebuffer for golden images (0 when drawing to window)
+GLuint offscreenFramebuffer = 0;
+GLuint offscreenColorBuffer = 0;
+GLuint offscreenDepthBuffer = 0;
+
+// Capture statistics
+int droppedCaptureFrames = 0;
+int writtenCaptureFrames = 0;
+Uint64 captureTime = 0;
+
+// Command line parsing
+void parseArguments(int argc, char* args[]);
+
+// Capture initialization
+bool initializeCapture();
+
+// Exit capture
+void exitCapture();
+
+// Read back rendered frame
+void captureFrame();
+
+// Pass finished pixel buffer to encoder
+void collectCaptureBuffer(int id);
+
+// Encoder thread
+int captureThreadFunction(void *data);
+
+// Write frame to video
+void writeCaptureFrame(Uint8 *frame);
+
+// Compare frame with golden image
+void compareWithGolden(Uint8 *frame);
+
 // Main function
 int main (int argc, char* args[]) {
+    // Read options
+    parseArguments(argc, args);
+    
     // Initialization
     if(!initializeSDL()) {
         printf( "Error while initializing SDL...\n" );
         return 1;
     } else {
-        // Read map file
-        SDL_Surface *mapFile = readTexturesFromFile("map.bmp");
-        mapWidth = mapFile->w;
-        mapHeight = mapFile->h;
-        map = new int* [mapWidth];
-        allDoors = new DoorStruct* [mapWidth];
-        for (int x = 0; x < mapWidth; x++) {
-            map[x] = new int[mapHeight];
-            allDoors[x] = new DoorStruct[mapHeight];
-        }
-        for (int y = 0; y < mapHeight; y++) {
-            for (int x = 0; x < mapWidth; x++) {
-                int color = getPixelColor(mapFile, x, y);
-                map[x][y] = 0;
-                allDoors[x][y].animation = 0.0f;
-                if (color == 16777215) {
-                    map[x][y] = 1;
-                }
-                else if (color == 16711680) {
-                    map[x][y] = 2;
-                    allDoors[x][y].animation = 1.0f;
-                }
-                else if (color == 255) {
-                    playerPositionX = x + 0.5f;
-                    playerPositionZ = y + 0.5f;
-                    if (getPixelColor(mapFile, x-1, y) == 16776960) {
-                        cameraX = 270;
-                    }
-                    else if (getPixelColor(mapFile, x, y-1) == 16776960) {
-                        cameraX = 0;
-                    }
-                    else if (getPixelColor(mapFile, x+1, y) == 16776960) {
-                        cameraX = 90;
-                    }
-                    else if (getPixelColor(mapFile, x, y+1) == 16776960) {
-                        cameraX = 180;
-                    }
-                }
-            }
+        // Read or generate map
+        SDL_Surface *mapFile = generatedMapSize > 0 ? generateMap(generatedMapSize, generatedMapSize) : readTexturesFromFile(mapFileName);
+        if (mapFile == NULL) {
+            exitSDL();
+            return 1;
+        }
+        if (savedMapFileName != NULL && SDL_SaveBMP(mapFile, savedMapFileName) < 0) {
+            printf("Error while saving map: \"%s\"\n", SDL_GetError());
         }
+        loadMap(mapFile);
+        SDL_FreeSurface(mapFile);
         
         // Read all textures
         textures = readTexturesFromFile("textures.bmp");
@@ -173,6 +422,12 @@ int main (int argc, char* args[]) {
         loadSingleTexture(0, trimTexture(textures, 128, 128, 64, 64));
         loadSingleTexture(1, trimTexture(textures, 128, 1024, 64, 64));
         
+        // Run benchmark instead of game
+        if (benchmarkMode) {
+            runBenchmark();
+            endOfGameFlag = true;
+        }
+        
         // Event handler
         SDL_Event event;
         
@@ -244,27 +499,7 @@ int main (int argc, char* args[]) {
             }
             
             // Opening doors
-            for (int y = 0; y < mapHeight; y++) {
-                for (int x = 0; x < mapWidth; x++) {
-                    if (map[x][y] == 2 && allDoors[x][y].animation < 1.0f) {
-                        allDoors[x][y].animation -= 0.05f;
-                        if (allDoors[x][y].animation <= 0.0501f) {
-                            allDoors[x][y].animation = 0.05f;
-                            map[x][y] = 3;
-                        }
-                    } else if (map[x][y] == 3) {
-                        if (allDoors[x][y].animationTime <= SDL_GetTicks() && ((int)playerPositionX != x || (int)playerPositionZ != y)) {
-                            map[x][y] = 4;
-                        }
-                    } else if (map[x][y] == 4 && allDoors[x][y].animation < 1.0f) {
-                        allDoors[x][y].animation += 0.05f;
-                        if (allDoors[x][y].animation >= 0.9501f) {
-                            allDoors[x][y].animation = 1.0f;
-                            map[x][y] = 2;
-                        }
-                    }
-                }
-            }
+            updateDoors();
             
             // Open doors
             if (spacebar == true) {
@@ -278,6 +513,8 @@ int main (int argc, char* args[]) {
                             if (xKwadrat + yKwadrat <= 1.0) {
                                 allDoors[(int)playerPositionX + x][(int)playerPositionZ + y].animation -= 0.05;
                                 allDoors[(int)playerPositionX + x][(int)playerPositionZ + y].animationTime = SDL_GetTicks() + 3000;
+                                sendSoundEvent(SOUND_EVENT_PLAY, SOUND_DOOR_OPEN, ((int)playerPositionX + x) * mapHeight + (int)playerPositionZ + y,
+                                               (int)playerPositionX + x + 0.5f, (int)playerPositionZ + y + 0.5f);
                             }
                         }
                     }
@@ -285,12 +522,27 @@ int main (int argc, char* args[]) {
                 spacebar = false;
             }
             
+            // Move listener
+            listenerX.store(playerPositionX, std::memory_order_relaxed);
+            listenerZ.store(playerPositionZ, std::memory_order_relaxed);
+            listenerAngle.store(cameraX, std::memory_order_relaxed);
+            
             // Update frame
             updateFrame();
             
             // Render sceen
             renderScene();
             
+            // Capture frame
+            if (captureFileName != NULL || goldenFileName != NULL) {
+                captureFrame();
+                
+                // Golden image needs only first frame
+                if (goldenFileName != NULL) {
+                    endOfGameFlag = true;
+                }
+            }
+            
             // Update window
             SDL_GL_SwapWindow(mainWindow);
         }
@@ -302,7 +554,139 @@ int main (int argc, char* args[]) {
     // Remove all SDL things
     exitSDL();
     
-    return 0;
+    return exitCode;
+}
+
+// Allocate map
+void allocateMap(int width, int height) {
+    mapWidth = width;
+    mapHeight = height;
+    
+    // Columns start empty, so freeMap() works even when allocation fails halfway
+    map = new int* [mapWidth]();
+    allDoors = new DoorStruct* [mapWidth]();
+    for (int x = 0; x < mapWidth; x++) {
+        map[x] = new int[mapHeight];
+        allDoors[x] = new DoorStruct[mapHeight];
+    }
+}
+
+// Release map
+void freeMap() {
+    for (int x = 0; x < mapWidth; x++) {
+        if (map != NULL) {
+            delete [] map[x];
+        }
+        if (allDoors != NULL) {
+            delete [] allDoors[x];
+        }
+    }
+    delete [] map;
+    delete [] allDoors;
+    map = NULL;
+    allDoors = NULL;
+    mapWidth = 0;
+    mapHeight = 0;
+}
+
+// Read map from its picture
+void loadMap(SDL_Surface *mapFile) {
+    allocateMap(mapFile->w, mapFile->h);
+    for (int y = 0; y < mapHeight; y++) {
+        for (int x = 0; x < mapWidth; x++) {
+            int color = getPixelColor(mapFile, x, y);
+            map[x][y] = 0;
+            allDoors[x][y].animation = 0.0f;
+            if (color == 16777215) {
+                map[x][y] = 1;
+            }
+            else if (color == 16711680) {
+                map[x][y] = 2;
+                allDoors[x][y].animation = 1.0f;
+            }
+            else if (color == 255) {
+                playerPositionX = x + 0.5f;
+                playerPositionZ = y + 0.5f;
+                if (getPixelColor(mapFile, x-1, y) == 16776960) {
+                    cameraX = 270;
+                }
+                else if (getPixelColor(mapFile, x, y-1) == 16776960) {
+                    cameraX = 0;
+                }
+                else if (getPixelColor(mapFile, x+1, y) == 16776960) {
+                    cameraX = 90;
+                }
+                else if (getPixelColor(mapFile, x, y+1) == 16776960) {
+                    cameraX = 180;
+                }
+            }
+        }
+    }
+}
+
+// Animate all doors
+void updateDoors() {
+    for (int y = 0; y < mapHeight; y++) {
+        for (int x = 0; x < mapWidth; x++) {
+            if (map[x][y] == 2 && allDoors[x][y].animation < 1.0f) {
+                allDoors[x][y].animation -= 0.05f;
+                if (allDoors[x][y].animation <= 0.0501f) {
+                    allDoors[x][y].animation = 0.05f;
+                    map[x][y] = 3;
+                }
+            } else if (map[x][y] == 3) {
+                if (allDoors[x][y].animationTime <= SDL_GetTicks() && ((int)playerPositionX != x || (int)playerPositionZ != y)) {
+                    map[x][y] = 4;
+                    sendSoundEvent(SOUND_EVENT_STOP, SOUND_DOOR_OPEN, x * mapHeight + y, x + 0.5f, y + 0.5f);
+                    sendSoundEvent(SOUND_EVENT_PLAY, SOUND_DOOR_CLOSE, x * mapHeight + y, x + 0.5f, y + 0.5f);
+                }
+            } else if (map[x][y] == 4 && allDoors[x][y].animation < 1.0f) {
+                allDoors[x][y].animation += 0.05f;
+                if (allDoors[x][y].animation >= 0.9501f) {
+                    allDoors[x][y].animation = 1.0f;
+                    map[x][y] = 2;
+                }
+            }
+        }
+    }
+}
+
+// Parse command line
+void parseArguments(int argc, char* args[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(args[i], "--map=", 6) == 0) {
+            mapFileName = args[i] + 6;
+        } else if (strncmp(args[i], "--generate=", 11) == 0) {
+            generatedMapSize = atoi(args[i] + 11);
+        } else if (strncmp(args[i], "--save-map=", 11) == 0) {
+            savedMapFileName = args[i] + 11;
+        } else if (strncmp(args[i], "--seed=", 7) == 0) {
+            generatorSeed = (unsigned int)strtoul(args[i] + 7, NULL, 10);
+        } else if (strncmp(args[i], "--rooms=", 8) == 0) {
+            roomDensity = atof(args[i] + 8);
+        } else if (strncmp(args[i], "--corridors=", 12) == 0) {
+            corridorDensity = atof(args[i] + 12);
+        } else if (strncmp(args[i], "--doors=", 8) == 0) {
+            doorDensity = atof(args[i] + 8);
+        } else if (strcmp(args[i], "--benchmark") == 0) {
+            benchmarkMode = true;
+        } else if (strncmp(args[i], "--benchmark-max=", 16) == 0) {
+            benchmarkMode = true;
+            benchmarkMaxSize = atoi(args[i] + 16);
+        } else if (strcmp(args[i], "--depth-prepass") == 0) {
+            depthPrepass = true;
+        } else if (strcmp(args[i], "--plain-order") == 0) {
+            plainDrawingOrder = true;
+        } else if (strcmp(args[i], "--overdraw") == 0) {
+            overdrawCounter = true;
+        } else if (strncmp(args[i], "--record=", 9) == 0) {
+            captureFileName = args[i] + 9;
+        } else if (strncmp(args[i], "--golden=", 9) == 0) {
+            goldenFileName = args[i] + 9;
+        } else {
+            printf("Unknown option: %s\n", args[i]);
+        }
+    }
 }
 
 // Initialize SDL
@@ -320,7 +704,9 @@ bool initializeSDL() {
         SDL_GL_SetAttribute( SDL_GL_CONTEXT_MINOR_VERSION, 1 );
         
         // Create window
-        mainWindow = SDL_CreateWindow("Wolfenstein 3D", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screenWidth, screenHeight, SDL_WINDOW_OPENGL | SDL_WINDOW_SHOWN);
+        // Golden images are rendered offscreen, so window is not needed
+        Uint32 windowFlags = goldenFileName != NULL ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN;
+        mainWindow = SDL_CreateWindow("Wolfenstein 3D", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, screenWidth, screenHeight, SDL_WINDOW_OPENGL | windowFlags);
         if (mainWindow == NULL) {
             printf("Window cannot be created! Error: %s\n", SDL_GetError());
             success = false;
@@ -341,6 +727,22 @@ bool initializeSDL() {
                     printf("Could not initialize OpenGL!\n");
                     success = false;
                 }
+                
+                // Initialize overdraw counter
+                if (overdrawCounter) {
+                    initializeOverdrawCounter();
+                }
+                
+                // Initialize audio (game runs silent without it)
+                if (!initializeAudio()) {
+                    printf("Could not initialize audio! Error: %s\n", SDL_GetError());
+                }
+                
+                // Initialize capture
+                if ((captureFileName != NULL || goldenFileName != NULL) && !initializeCapture()) {
+                    printf("Could not initialize capture!\n");
+                    success = false;
+                }
             }
         }
     }
@@ -383,10 +785,8 @@ bool initializeOpenGL()
     // Turn on normalization
     glEnable(GL_NORMALIZE);
     
-    // Turn on blending
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA_SATURATE, GL_ONE);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // All geometry is opaque, blending stays off
+    glDisable(GL_BLEND);
     
     // Turn on smoothing
     glShadeModel(GL_SMOOTH);
@@ -450,72 +850,43 @@ void renderScene()
     // Translate matrix over player's position
     glTranslatef(-playerPositionX, -playerPositionY-0.5f, -playerPositionZ);
     
-    // Draw map
-    for (int x = 0; x < mapWidth; x++) {
-        for (int y = 0; y < mapHeight; y++) {
-            // Draw wall
-            if (map[x][y] == 1) {
-                // Prepare corners and walls
-                int drawingMode = 6;
-                bool corners[4] = {false, false, false, false};
-                int cornersCount = 0;
-                if ((y >= 1 && map[x][y-1] != 0) || (y <= mapHeight-2 && map[x][y+1] != 0)) drawingMode = 0;
-                if ((x >= 1 && map[x-1][y] != 0) || (x <= mapWidth-2 && map[x+1][y] != 0)) drawingMode = 1;
-                if ((x >= 1 && map[x-1][y] != 0) && (y <= mapWidth-2 && map[x][y+1] != 0)) {drawingMode = 2; corners[0] = true; cornersCount++;}
-                if ((x <= mapWidth-2 && map[x+1][y] != 0) && (y <= mapWidth-2 && map[x][y+1] != 0)) {drawingMode = 3; corners[1] = true; cornersCount++;}
-                if ((x <= mapWidth-2 && map[x+1][y] != 0) && (y >= 1  && map[x][y-1] != 0)) {drawingMode = 4; corners[2] = true; cornersCount++;}
-                if ((x >= 1  && map[x-1][y] != 0) && (y >= 1  && map[x][y-1] != 0)) {drawingMode = 5; corners[3] = true; cornersCount++;}
-                
-                // Default wall and wall type L
-                if (cornersCount == 0 || cornersCount == 1) {
-                    drawDoubleWall(x, y, drawingMode);
-                }
-                // Type T
-                else if (cornersCount == 2) {
-                    if (corners[0] && corners[3]) {
-                        drawDoubleWall(x, y, 0);
-                        // Half of the wall
-                        drawSigleWall(x, y+0.5-wallThickness, x+0.5, y+0.5-wallThickness);
-                        drawSigleWall(x, y+0.5+wallThickness, x+0.5, y+0.5+wallThickness);
-                        drawSigleWall(x, y+0.5-wallThickness, x, y+0.5+wallThickness);
-                    }
-                    if (corners[0] && corners[1]) {
-                        drawDoubleWall(x, y, 1);
-                        // Half of the wall
-                        drawSigleWall(x+0.5-wallThickness, y+0.5, x+0.5-wallThickness, y+1.0);
-                        drawSigleWall(x+0.5+wallThickness, y+0.5, x+0.5+wallThickness, y+1.0);
-                        drawSigleWall(x+0.5-wallThickness, y+1.0, x+0.5+wallThickness, y+1.0);
-                    }
-                    if (corners[1] && corners[2]) {
-                        drawDoubleWall(x, y, 0);
-                        // Half of the wall
-                        drawSigleWall(x+0.5, y+0.5-wallThickness, x+1.0, y+0.5-wallThickness);
-                        drawSigleWall(x+0.5, y+0.5+wallThickness, x+1.0, y+0.5+wallThickness);
-                        drawSigleWall(x+1.0, y+0.5-wallThickness, x+1.0, y+0.5+wallThickness);
-                    }
-                    if (corners[2] && corners[3]) {
-                        drawDoubleWall(x, y, 1);
-                        // Half of the wall
-                        drawSigleWall(x+0.5-wallThickness, y, x+0.5-wallThickness, y+0.5);
-                        drawSigleWall(x+0.5+wallThickness, y, x+0.5+wallThickness, y+0.5);
-                        drawSigleWall(x+0.5-wallThickness, y, x+0.5+wallThickness, y);
-                    }
-                }
-                // Type X
-                else if (cornersCount == 4) {
-                    drawDoubleWall(x, y, 0);
-                    drawDoubleWall(x, y, 1);
-                }
-            }
-            // Draw doors
-            else if (map[x][y] == 2 || map[x][y] == 3 || map[x][y] == 4) {
-                if ((y >= 1 && map[x][y-1] != 0) || (y <= mapHeight-2 && map[x][y+1] != 0)) drawDoubleDoor(x, y, 0);
-                else if ((x >= 1 && map[x-1][y] != 0) || (x <= mapWidth-2 && map[x+1][y] != 0)) drawDoubleDoor(x, y, 1);
-            }
-            
-            // Draw floor
-            drawFloor(x, y, x + 1, y + 1);
+    // Queries of this frame replace ones from few frames ago
+    int query = overdrawFrames % overdrawQueriesCount;
+    if (overdrawCounter && overdrawFrames >= overdrawQueriesCount) {
+        collectOverdrawQuery(query);
+    }
+    
+    // Fill depth buffer first, so hidden fragments are not shaded later
+    if (depthPrepass) {
+        depthOnlyPass = true;
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        if (overdrawCounter) {
+            glBeginQuery(GL_SAMPLES_PASSED, depthPassQueries[query]);
+        }
+        drawMap();
+        if (overdrawCounter) {
+            glEndQuery(GL_SAMPLES_PASSED);
         }
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        depthOnlyPass = false;
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+    }
+    
+    // Draw map
+    if (overdrawCounter) {
+        glBeginQuery(GL_SAMPLES_PASSED, colorPassQueries[query]);
+    }
+    drawMap();
+    if (overdrawCounter) {
+        glEndQuery(GL_SAMPLES_PASSED);
+        overdrawFrames++;
+    }
+    
+    // Restore depth settings
+    if (depthPrepass) {
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
     }
     
     // Release matrix from stack
@@ -525,9 +896,120 @@ void renderScene()
     glFlush();
 }
 
+// Draw map starting from player's cell
+void drawMap() {
+    // Old order, kept to measure what sorting saves
+    if (plainDrawingOrder) {
+        for (int x = 0; x < mapWidth; x++) {
+            for (int y = 0; y < mapHeight; y++) {
+                drawCell(x, y);
+            }
+        }
+        return;
+    }
+    
+    int playerX = (int)playerPositionX;
+    int playerY = (int)playerPositionZ;
+    int maxDistance = max(max(playerX, mapWidth - 1 - playerX), max(playerY, mapHeight - 1 - playerY));
+    
+    // Rings of cells around the player, nearest first
+    for (int distance = 0; distance <= maxDistance; distance++) {
+        for (int x = playerX - distance; x <= playerX + distance; x++) {
+            if (x < 0 || x >= mapWidth) {
+                continue;
+            }
+            
+            // Whole column on the sides of the ring, only top and bottom cells inside
+            int step = (x == playerX - distance || x == playerX + distance) ? 1 : 2 * distance;
+            for (int y = playerY - distance; y <= playerY + distance; y += step) {
+                if (y >= 0 && y < mapHeight) {
+                    drawCell(x, y);
+                }
+            }
+        }
+    }
+}
+
+// Draw single cell of the map
+void drawCell(int x, int y) {
+    // Draw wall
+    if (map[x][y] == 1) {
+        // Prepare corners and walls
+        int drawingMode = 6;
+        bool corners[4] = {false, false, false, false};
+        int cornersCount = 0;
+        if ((y >= 1 && map[x][y-1] != 0) || (y <= mapHeight-2 && map[x][y+1] != 0)) drawingMode = 0;
+        if ((x >= 1 && map[x-1][y] != 0) || (x <= mapWidth-2 && map[x+1][y] != 0)) drawingMode = 1;
+        if ((x >= 1 && map[x-1][y] != 0) && (y <= mapWidth-2 && map[x][y+1] != 0)) {drawingMode = 2; corners[0] = true; cornersCount++;}
+        if ((x <= mapWidth-2 && map[x+1][y] != 0) && (y <= mapWidth-2 && map[x][y+1] != 0)) {drawingMode = 3; corners[1] = true; cornersCount++;}
+        if ((x <= mapWidth-2 && map[x+1][y] != 0) && (y >= 1  && map[x][y-1] != 0)) {drawingMode = 4; corners[2] = true; cornersCount++;}
+        if ((x >= 1  && map[x-1][y] != 0) && (y >= 1  && map[x][y-1] != 0)) {drawingMode = 5; corners[3] = true; cornersCount++;}
+        
+        // Default wall and wall type L
+        if (cornersCount == 0 || cornersCount == 1) {
+            drawDoubleWall(x, y, drawingMode);
+        }
+        // Type T
+        else if (cornersCount == 2) {
+            if (corners[0] && corners[3]) {
+                drawDoubleWall(x, y, 0);
+                // Half of the wall
+                drawSigleWall(x, y+0.5-wallThickness, x+0.5, y+0.5-wallThickness);
+                drawSigleWall(x, y+0.5+wallThickness, x+0.5, y+0.5+wallThickness);
+                drawSigleWall(x, y+0.5-wallThickness, x, y+0.5+wallThickness);
+            }
+            if (corners[0] && corners[1]) {
+                drawDoubleWall(x, y, 1);
+                // Half of the wall
+                drawSigleWall(x+0.5-wallThickness, y+0.5, x+0.5-wallThickness, y+1.0);
+                drawSigleWall(x+0.5+wallThickness, y+0.5, x+0.5+wallThickness, y+1.0);
+                drawSigleWall(x+0.5-wallThickness, y+1.0, x+0.5+wallThickness, y+1.0);
+            }
+            if (corners[1] && corners[2]) {
+                drawDoubleWall(x, y, 0);
+                // Half of the wall
+                drawSigleWall(x+0.5, y+0.5-wallThickness, x+1.0, y+0.5-wallThickness);
+                drawSigleWall(x+0.5, y+0.5+wallThickness, x+1.0, y+0.5+wallThickness);
+                drawSigleWall(x+1.0, y+0.5-wallThickness, x+1.0, y+0.5+wallThickness);
+            }
+            if (corners[2] && corners[3]) {
+                drawDoubleWall(x, y, 1);
+                // Half of the wall
+                drawSigleWall(x+0.5-wallThickness, y, x+0.5-wallThickness, y+0.5);
+                drawSigleWall(x+0.5+wallThickness, y, x+0.5+wallThickness, y+0.5);
+                drawSigleWall(x+0.5-wallThickness, y, x+0.5+wallThickness, y);
+            }
+        }
+        // Type X
+        else if (cornersCount == 4) {
+            drawDoubleWall(x, y, 0);
+            drawDoubleWall(x, y, 1);
+        }
+    }
+    // Draw doors
+    else if (map[x][y] == 2 || map[x][y] == 3 || map[x][y] == 4) {
+        if ((y >= 1 && map[x][y-1] != 0) || (y <= mapHeight-2 && map[x][y+1] != 0)) drawDoubleDoor(x, y, 0);
+        else if ((x >= 1 && map[x-1][y] != 0) || (x <= mapWidth-2 && map[x+1][y] != 0)) drawDoubleDoor(x, y, 1);
+    }
+    
+    // Draw floor (nothing is behind it, so depth pass can skip it)
+    if (!depthOnlyPass) {
+        drawFloor(x, y, x + 1, y + 1);
+    }
+}
+
 // End up using SDL
 void exitSDL()
 {
+    // Stop the mixer
+    exitAudio();
+    
+    // Finish writing captured frames
+    exitCapture();
+    
+    // Print overdraw
+    exitOverdrawCounter();
+    
     // Destroy the main window
     SDL_DestroyWindow(mainWindow);
     mainWindow = NULL;
@@ -536,17 +1018,713 @@ void exitSDL()
     SDL_Quit();
 }
 
-// Draw single wall
-void drawSigleWall(float x1, float y1, float x2, float y2) {
-    // Choose texture to draw
-    glBindTexture(GL_TEXTURE_2D, readTextures[0]);
+// Initialize audio
+bool initializeAudio() {
+    // Prepare sounds before the callback can use them
+    generateSounds();
+    
+    // Request signed 16-bit stereo, SDL converts if the device wants something else
+    SDL_AudioSpec desired;
+    SDL_AudioSpec obtained;
+    memset(&desired, 0, sizeof(desired));
+    desired.freq = audioFrequency;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 2;
+    desired.samples = audioBufferSize;
+    desired.callback = audioCallback;
+    
+    audioDevice = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
+    if (audioDevice == 0) {
+        return false;
+    }
+    audioCallbackPeriod = SDL_GetPerformanceFrequency() * obtained.samples / obtained.freq;
+    printf("Audio driver: %s\n", SDL_GetCurrentAudioDriver());
     
-    // Setup texture settings
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // Start playing
+    SDL_PauseAudioDevice(audioDevice, 0);
     
-    // Enable using texture
-    glEnable(GL_TEXTURE_2D);
+    return true;
+}
+
+// End up using audio
+void exitAudio() {
+    if (audioDevice != 0) {
+        SDL_CloseAudioDevice(audioDevice);
+        audioDevice = 0;
+        printf("Audio: %d callbacks, %d under-runs, %d stolen voices, %d dropped events\n",
+               audioCallbacks.load(), audioUnderruns.load(), stolenVoices, droppedSoundEvents);
+    }
+    for (int i = 0; i < SOUNDS_COUNT; i++) {
+        delete [] sounds[i];
+        sounds[i] = NULL;
+    }
+}
+
+// Generate door sounds
+void generateSounds() {
+    // Sliding part lasts as long as door animation
+    int slideLength = audioFrequency * 35 / 100;
+    int thumpLength = audioFrequency / 5;
+    soundLengths[SOUND_DOOR_OPEN] = slideLength;
+    soundLengths[SOUND_DOOR_CLOSE] = slideLength + thumpLength;
+    
+    for (int i = 0; i < SOUNDS_COUNT; i++) {
+        sounds[i] = new float[soundLengths[i]];
+        
+        // Rumble made of filtered noise and low tone
+        unsigned int noise = 22695477u * (i + 1);
+        float filtered = 0.0f;
+        for (int j = 0; j < slideLength; j++) {
+            float time = (float)j / audioFrequency;
+            noise = noise * 1664525u + 1013904223u;
+            filtered += 0.05f * (((noise >> 8) & 0xFFFF) / 32768.0f - 1.0f - filtered);
+            float envelope = min(1.0f, time / 0.02f) * min(1.0f, (float)(slideLength - j) / (audioFrequency * 0.05f));
+            sounds[i][j] = envelope * (0.6f * filtered + 0.2f * sin(2.0f * M_PI * 70.0f * time));
+        }
+        
+        // Closing door hits the frame
+        for (int j = slideLength; j < soundLengths[i]; j++) {
+            float time = (float)(j - slideLength) / audioFrequency;
+            sounds[i][j] = 0.8f * sin(2.0f * M_PI * 55.0f * time) * exp(-time * 20.0f);
+        }
+    }
+}
+
+// Send event to the mixer
+void sendSoundEvent(int type, int sound, int key, float x, float z) {
+    // No sound
+    if (audioDevice == 0) {
+        return;
+    }
+    
+    SoundEvent event;
+    event.type = type;
+    event.sound = sound;
+    event.key = key;
+    event.x = x;
+    event.z = z;
+    
+    // Queue is full, mixer is not keeping up
+    if (!soundEvents.push(event)) {
+        droppedSoundEvents++;
+    }
+}
+
+// Mix all voices (runs on audio thread, must not lock or allocate)
+void audioCallback(void *userdata, Uint8 *stream, int length) {
+    // Count callbacks which came too late
+    Uint64 now = SDL_GetPerformanceCounter();
+    if (lastAudioCallback != 0 && now - lastAudioCallback > audioCallbackPeriod * 3 / 2) {
+        audioUnderruns++;
+    }
+    lastAudioCallback = now;
+    audioCallbacks++;
+    
+    // Apply events from the game
+    SoundEvent event;
+    while (soundEvents.pop(event)) {
+        if (event.type == SOUND_EVENT_STOP) {
+            for (int i = 0; i < audioVoicesCount; i++) {
+                if (voices[i].active && voices[i].key == event.key && voices[i].sound == event.sound) {
+                    voices[i].active = false;
+                }
+            }
+        } else if (event.type == SOUND_EVENT_PLAY) {
+            // Take free voice or steal the one which plays longest
+            int chosen = 0;
+            for (int i = 0; i < audioVoicesCount; i++) {
+                if (!voices[i].active) {
+                    chosen = i;
+                    break;
+                }
+                if (voices[i].position > voices[chosen].position) {
+                    chosen = i;
+                }
+            }
+            if (voices[chosen].active) {
+                stolenVoices++;
+            }
+            voices[chosen].active = true;
+            voices[chosen].sound = event.sound;
+            voices[chosen].key = event.key;
+            voices[chosen].position = 0;
+            voices[chosen].x = event.x;
+            voices[chosen].z = event.z;
+        }
+    }
+    
+    // Attenuation and panning relative to player
+    float leftGains[audioVoicesCount];
+    float rightGains[audioVoicesCount];
+    float x = listenerX.load(std::memory_order_relaxed);
+    float z = listenerZ.load(std::memory_order_relaxed);
+    float angle = listenerAngle.load(std::memory_order_relaxed);
+    float rightX = cos(angle * M_PI / 180.0f);
+    float rightZ = sin(angle * M_PI / 180.0f);
+    for (int i = 0; i < audioVoicesCount; i++) {
+        float dx = voices[i].x - x;
+        float dz = voices[i].z - z;
+        float distance = sqrt(dx * dx + dz * dz);
+        float gain = distance < audioMaxDistance ? 1.0f / (1.0f + audioRolloff * distance) : 0.0f;
+        float pan = distance > 0.001f ? (dx * rightX + dz * rightZ) / distance : 0.0f;
+        leftGains[i] = gain * cos((pan + 1.0f) * M_PI / 4.0f);
+        rightGains[i] = gain * sin((pan + 1.0f) * M_PI / 4.0f);
+    }
+    
+    // Mix into stereo output
+    Sint16 *output = (Sint16 *)stream;
+    int frames = length / (2 * sizeof(Sint16));
+    for (int frame = 0; frame < frames; frame++) {
+        float left = 0.0f;
+        float right = 0.0f;
+        for (int i = 0; i < audioVoicesCount; i++) {
+            if (voices[i].active) {
+                float sample = sounds[voices[i].sound][voices[i].position];
+                left += sample * leftGains[i];
+                right += sample * rightGains[i];
+                if (++voices[i].position >= soundLengths[voices[i].sound]) {
+                    voices[i].active = false;
+                }
+            }
+        }
+        output[2 * frame] = (Sint16)(max(-1.0f, min(1.0f, left)) * 32767.0f);
+        output[2 * frame + 1] = (Sint16)(max(-1.0f, min(1.0f, right)) * 32767.0f);
+    }
+}
+
+// Generate map in the same colors as map file
+SDL_Surface* generateMap(int width, int height) {
+    // Every cell needs space for a room and walls around it
+    if (width < 16 || height < 16) {
+        printf("Generated map is too small: %dx%d\n", width, height);
+        return NULL;
+    }
+    
+    SDL_Surface *mapFile = SDL_CreateRGBSurface(0, width, height, 24, 0xFF0000, 0x00FF00, 0x0000FF, 0);
+    if (mapFile == NULL) {
+        printf("Error while generating map: \"%s\"\n", SDL_GetError());
+        return NULL;
+    }
+    generatorState = generatorSeed != 0 ? generatorSeed : 1;
+    
+    // Walls everywhere
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            setPixelColor(mapFile, x, y, 16777215);
+        }
+    }
+    
+    // Split map into cells, each one holds a room or a corridor junction
+    int cellsX = max(1, (width - 2) / generatorCellSize);
+    int cellsY = max(1, (height - 2) / generatorCellSize);
+    int cellWidth = (width - 2) / cellsX;
+    int cellHeight = (height - 2) / cellsY;
+    vector<SDL_Rect> rooms(cellsX * cellsY);
+    for (int cy = 0; cy < cellsY; cy++) {
+        for (int cx = 0; cx < cellsX; cx++) {
+            SDL_Rect &room = rooms[cy * cellsX + cx];
+            if (cy * cellsX + cx == 0 || randomFloat() < roomDensity) {
+                room.w = 3 + randomNumber() % (cellWidth - 4);
+                room.h = 3 + randomNumber() % (cellHeight - 4);
+            } else {
+                room.w = 1;
+                room.h = 1;
+            }
+            room.x = 1 + cx * cellWidth + 1 + randomNumber() % (cellWidth - 1 - room.w);
+            room.y = 1 + cy * cellHeight + 1 + randomNumber() % (cellHeight - 1 - room.h);
+            for (int y = room.y; y < room.y + room.h; y++) {
+                for (int x = room.x; x < room.x + room.w; x++) {
+                    setPixelColor(mapFile, x, y, 0);
+                }
+            }
+        }
+    }
+    
+    // Connect all cells (random spanning tree)
+    vector<SDL_Rect> doors;
+    vector<char> visited(rooms.size(), 0);
+    vector<int> stack;
+    stack.push_back(0);
+    visited[0] = 1;
+    while (!stack.empty()) {
+        int cell = stack.back();
+        int cx = cell % cellsX;
+        int cy = cell / cellsX;
+        int neighbours[4];
+        int count = 0;
+        if (cx > 0 && !visited[cell - 1]) neighbours[count++] = cell - 1;
+        if (cx < cellsX - 1 && !visited[cell + 1]) neighbours[count++] = cell + 1;
+        if (cy > 0 && !visited[cell - cellsX]) neighbours[count++] = cell - cellsX;
+        if (cy < cellsY - 1 && !visited[cell + cellsX]) neighbours[count++] = cell + cellsX;
+        if (count == 0) {
+            stack.pop_back();
+            continue;
+        }
+        int next = neighbours[randomNumber() % count];
+        visited[next] = 1;
+        connectRooms(mapFile, rooms[cell], rooms[next], doors);
+        stack.push_back(next);
+    }
+    
+    // Additional corridors make loops
+    for (int cy = 0; cy < cellsY; cy++) {
+        for (int cx = 0; cx < cellsX; cx++) {
+            if (cx < cellsX - 1 && randomFloat() < corridorDensity) {
+                connectRooms(mapFile, rooms[cy * cellsX + cx], rooms[cy * cellsX + cx + 1], doors);
+            }
+            if (cy < cellsY - 1 && randomFloat() < corridorDensity) {
+                connectRooms(mapFile, rooms[cy * cellsX + cx], rooms[(cy + 1) * cellsX + cx], doors);
+            }
+        }
+    }
+    
+    // Doors need walls on both sides and free space in front and behind
+    for (size_t i = 0; i < doors.size(); i++) {
+        int x = doors[i].x;
+        int y = doors[i].y;
+        bool horizontal = getPixelColor(mapFile, x, y-1) == 16777215 && getPixelColor(mapFile, x, y+1) == 16777215 &&
+                          getPixelColor(mapFile, x-1, y) == 0 && getPixelColor(mapFile, x+1, y) == 0;
+        bool vertical = getPixelColor(mapFile, x-1, y) == 16777215 && getPixelColor(mapFile, x+1, y) == 16777215 &&
+                        getPixelColor(mapFile, x, y-1) == 0 && getPixelColor(mapFile, x, y+1) == 0;
+        if (getPixelColor(mapFile, x, y) == 0 && (horizontal || vertical) && randomFloat() < doorDensity) {
+            setPixelColor(mapFile, x, y, 16711680);
+        }
+    }
+    
+    // Player starts in the first room looking up
+    setPixelColor(mapFile, rooms[0].x + 1, rooms[0].y + 1, 255);
+    setPixelColor(mapFile, rooms[0].x + 1, rooms[0].y, 16776960);
+    
+    return mapFile;
+}
+
+// Dig L-shaped corridor between centers of two rooms
+void connectRooms(SDL_Surface *mapFile, SDL_Rect a, SDL_Rect b, vector<SDL_Rect> &doors) {
+    int x = a.x + a.w / 2;
+    int y = a.y + a.h / 2;
+    int targetX = b.x + b.w / 2;
+    int targetY = b.y + b.h / 2;
+    while (x != targetX || y != targetY) {
+        int previousX = x;
+        int previousY = y;
+        if (x != targetX) {
+            x += x < targetX ? 1 : -1;
+        } else {
+            y += y < targetY ? 1 : -1;
+        }
+        setPixelColor(mapFile, x, y, 0);
+        
+        // Remember places where corridor leaves or enters a room
+        SDL_Rect door = {0, 0, 1, 1};
+        if (a.w > 1 && insideRoom(a, previousX, previousY) && !insideRoom(a, x, y) && !insideRoom(b, x, y)) {
+            door.x = x;
+            door.y = y;
+            doors.push_back(door);
+        } else if (b.w > 1 && insideRoom(b, x, y) && !insideRoom(b, previousX, previousY) && !insideRoom(a, previousX, previousY)) {
+            door.x = previousX;
+            door.y = previousY;
+            doors.push_back(door);
+        }
+    }
+}
+
+// Check if point is inside a room
+bool insideRoom(SDL_Rect room, int x, int y) {
+    return x >= room.x && x < room.x + room.w && y >= room.y && y < room.y + room.h;
+}
+
+// Xorshift, so generated maps are the same everywhere
+unsigned int randomNumber() {
+    generatorState ^= generatorState << 13;
+    generatorState ^= generatorState >> 17;
+    generatorState ^= generatorState << 5;
+    return generatorState;
+}
+
+// Random number from 0 to 1
+float randomFloat() {
+    return (randomNumber() & 0xFFFFFF) / 16777216.0f;
+}
+
+// Measure generating, loading and rendering maps of growing size
+void runBenchmark() {
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    printf("%8s %12s %10s %12s %12s %10s %10s\n", "size", "generate ms", "load ms", "estimate MB", "peak RSS MB", "doors ms", "frame ms");
+    for (int size = 32; size <= benchmarkMaxSize; size *= 2) {
+        // Generate and load map
+        Uint64 start = SDL_GetPerformanceCounter();
+        Uint64 generated = start;
+        SDL_Surface *mapFile = NULL;
+        try {
+            mapFile = generateMap(size, size);
+            if (mapFile == NULL) {
+                break;
+            }
+            generated = SDL_GetPerformanceCounter();
+            freeMap();
+            loadMap(mapFile);
+        } catch (std::bad_alloc &) {
+            // Stop instead of aborting, bigger maps will not fit either
+            printf("Not enough memory for %dx%d map, benchmark stopped\n", size, size);
+            if (mapFile != NULL) {
+                SDL_FreeSurface(mapFile);
+            }
+            freeMap();
+            break;
+        }
+        Uint64 loaded = SDL_GetPerformanceCounter();
+        
+        // Map picture and map are in memory at the same time
+        double memory = (double)mapFile->pitch * mapFile->h + (double)mapWidth * mapHeight * (sizeof(int) + sizeof(DoorStruct)) +
+                        (double)mapWidth * (sizeof(int *) + sizeof(DoorStruct *));
+        double peakMemory = peakMemoryUsage();
+        SDL_FreeSurface(mapFile);
+        
+        // Render few frames
+        Uint64 doorsTime = 0;
+        Uint64 framesTime = 0;
+        int frames = 0;
+        while (frames < benchmarkFrames && (frames == 0 || doorsTime + framesTime < frequency * benchmarkTimeLimit)) {
+            Uint64 frameStart = SDL_GetPerformanceCounter();
+            updateDoors();
+            Uint64 doorsEnd = SDL_GetPerformanceCounter();
+            renderScene();
+            glFinish();
+            doorsTime += doorsEnd - frameStart;
+            framesTime += SDL_GetPerformanceCounter() - doorsEnd;
+            frames++;
+        }
+        
+        printf("%8d %12.2f %10.2f %12.2f %12.2f %10.3f %10.3f\n", size,
+               1000.0 * (generated - start) / frequency,
+               1000.0 * (loaded - generated) / frequency,
+               memory / (1024.0 * 1024.0),
+               peakMemory,
+               1000.0 * doorsTime / frequency / frames,
+               1000.0 * framesTime / frequency / frames);
+    }
+}
+
+// Peak resident memory of the process
+double peakMemoryUsage() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    
+    // macOS reports bytes, Linux reports kilobytes
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+}
+
+// Initialize overdraw counter
+void initializeOverdrawCounter() {
+    glGenQueries(overdrawQueriesCount, depthPassQueries);
+    glGenQueries(overdrawQueriesCount, colorPassQueries);
+}
+
+// End up counting overdraw
+void exitOverdrawCounter() {
+    if (!overdrawCounter) {
+        return;
+    }
+    
+    // Collect queries still in flight
+    for (int i = max(0, overdrawFrames - overdrawQueriesCount); i < overdrawFrames; i++) {
+        collectOverdrawQuery(i % overdrawQueriesCount);
+    }
+    glDeleteQueries(overdrawQueriesCount, depthPassQueries);
+    glDeleteQueries(overdrawQueriesCount, colorPassQueries);
+    
+    // Fragments per pixel in each pass
+    double pixels = (double)max(1, collectedOverdrawFrames) * screenWidth * screenHeight;
+    printf("Overdraw: %.2f fragments per pixel in depth pass, %.2f in color pass, %.2f total (%d frames, %s order)\n",
+           depthPassSamples / pixels, colorPassSamples / pixels, (depthPassSamples + colorPassSamples) / pixels,
+           collectedOverdrawFrames, plainDrawingOrder ? "plain" : "front-to-back");
+}
+
+// Read query from earlier frame, so GPU is not waited for
+void collectOverdrawQuery(int id) {
+    GLuint samples = 0;
+    if (depthPrepass) {
+        glGetQueryObjectuiv(depthPassQueries[id], GL_QUERY_RESULT, &samples);
+        depthPassSamples += samples;
+    }
+    glGetQueryObjectuiv(colorPassQueries[id], GL_QUERY_RESULT, &samples);
+    colorPassSamples += samples;
+    collectedOverdrawFrames++;
+}
+
+// Initialize capture
+bool initializeCapture() {
+    // Open video file
+    if (captureFileName != NULL) {
+        captureFile = fopen(captureFileName, "wb");
+        if (captureFile == NULL) {
+            printf("Cannot open capture file: \"%s\"\n", captureFileName);
+            return false;
+        }
+        fprintf(captureFile, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C444\n", screenWidth, screenHeight);
+    }
+    
+    // Hidden window has undefined pixels, so golden image is drawn into own framebuffer
+    if (goldenFileName != NULL) {
+        glGenRenderbuffersEXT(1, &offscreenColorBuffer);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, offscreenColorBuffer);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, screenWidth, screenHeight);
+        glGenRenderbuffersEXT(1, &offscreenDepthBuffer);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, offscreenDepthBuffer);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, screenWidth, screenHeight);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, 0);
+        
+        glGenFramebuffersEXT(1, &offscreenFramebuffer);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, offscreenFramebuffer);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, offscreenColorBuffer);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, offscreenDepthBuffer);
+        if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+            printf("Offscreen framebuffer is not complete!\n");
+            return false;
+        }
+        
+        // Everything is drawn into and read from this framebuffer
+        glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT);
+        glReadBuffer(GL_COLOR_ATTACHMENT0_EXT);
+    }
+    
+    // Prepare pixel buffers
+    glGenBuffers(captureBuffersCount, capturePixelBuffers);
+    for (int i = 0; i < captureBuffersCount; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePixelBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, captureFrameSize, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    // Prepare frames for encoder
+    for (int i = 0; i < captureFramesCount; i++) {
+        captureFrames[i] = new Uint8[captureFrameSize];
+        freeCaptureFrames.push(i);
+    }
+    capturePlanes = new Uint8[screenWidth * screenHeight * 3];
+    
+    // Start encoder
+    captureSemaphore = SDL_CreateSemaphore(0);
+    captureThread = SDL_CreateThread(captureThreadFunction, "Capture", NULL);
+    if (captureThread == NULL) {
+        printf("Capture thread cannot be created! Error: %s\n", SDL_GetError());
+        return false;
+    }
+    
+    return true;
+}
+
+// End up capturing
+void exitCapture() {
+    // Nothing was captured
+    if (captureThread == NULL) {
+        return;
+    }
+    
+    // Collect frames still waiting in pixel buffers
+    for (int i = max(0, captureFrameNumber - captureBuffersCount); i < captureFrameNumber; i++) {
+        collectCaptureBuffer(i % captureBuffersCount);
+    }
+    glDeleteBuffers(captureBuffersCount, capturePixelBuffers);
+    
+    // Remove offscreen framebuffer
+    if (offscreenFramebuffer != 0) {
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glDeleteFramebuffersEXT(1, &offscreenFramebuffer);
+        glDeleteRenderbuffersEXT(1, &offscreenColorBuffer);
+        glDeleteRenderbuffersEXT(1, &offscreenDepthBuffer);
+        offscreenFramebuffer = 0;
+    }
+    
+    // Stop encoder
+    filledCaptureFrames.push(-1);
+    SDL_SemPost(captureSemaphore);
+    SDL_WaitThread(captureThread, NULL);
+    captureThread = NULL;
+    SDL_DestroySemaphore(captureSemaphore);
+    
+    // Release memory
+    for (int i = 0; i < captureFramesCount; i++) {
+        delete [] captureFrames[i];
+    }
+    delete [] capturePlanes;
+    if (captureFile != NULL) {
+        fclose(captureFile);
+    }
+    
+    printf("Capture: %d frames, %d written, %d dropped, %.3f ms overhead per frame\n",
+           captureFrameNumber, writtenCaptureFrames, droppedCaptureFrames,
+           captureFrameNumber > 0 ? 1000.0 * captureTime / SDL_GetPerformanceFrequency() / captureFrameNumber : 0.0);
+}
+
+// Read back rendered frame without waiting for GPU
+void captureFrame() {
+    Uint64 start = SDL_GetPerformanceCounter();
+    int id = captureFrameNumber % captureBuffersCount;
+    
+    // Buffer was filled few frames ago, so it should be ready now
+    if (captureFrameNumber >= captureBuffersCount) {
+        collectCaptureBuffer(id);
+    }
+    
+    // Start reading current frame
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePixelBuffers[id]);
+    glReadPixels(0, 0, screenWidth, screenHeight, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    
+    captureFrameNumber++;
+    captureTime += SDL_GetPerformanceCounter() - start;
+}
+
+// Copy pixel buffer into free frame
+void collectCaptureBuffer(int id) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePixelBuffers[id]);
+    void *pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    
+    // Renderer only takes free frames, encoder is the only one giving them back
+    int frame;
+    if (pixels == NULL) {
+        droppedCaptureFrames++;
+    } else if (!freeCaptureFrames.pop(frame)) {
+        // Encoder is too slow
+        droppedCaptureFrames++;
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        memcpy(captureFrames[frame], pixels, captureFrameSize);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        filledCaptureFrames.push(frame);
+        SDL_SemPost(captureSemaphore);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Write frames in background
+int captureThreadFunction(void *data) {
+    bool firstFrame = true;
+    while (true) {
+        SDL_SemWait(captureSemaphore);
+        int frame;
+        if (!filledCaptureFrames.pop(frame) || frame < 0) {
+            break;
+        }
+        
+        if (captureFile != NULL) {
+            writeCaptureFrame(captureFrames[frame]);
+        }
+        if (goldenFileName != NULL && firstFrame) {
+            compareWithGolden(captureFrames[frame]);
+        }
+        firstFrame = false;
+        
+        // Give frame back to renderer
+        freeCaptureFrames.push(frame);
+    }
+    
+    return 0;
+}
+
+// Convert BGRA frame into Y4M frame
+void writeCaptureFrame(Uint8 *frame) {
+    int planeSize = screenWidth * screenHeight;
+    for (int y = 0; y < screenHeight; y++) {
+        // OpenGL stores rows from the bottom
+        Uint8 *pixel = frame + (screenHeight - 1 - y) * screenWidth * 4;
+        for (int x = 0; x < screenWidth; x++, pixel += 4) {
+            int b = pixel[0];
+            int g = pixel[1];
+            int r = pixel[2];
+            capturePlanes[y * screenWidth + x] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+            capturePlanes[planeSize + y * screenWidth + x] = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+            capturePlanes[2 * planeSize + y * screenWidth + x] = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+        }
+    }
+    fputs("FRAME\n", captureFile);
+    fwrite(capturePlanes, 1, planeSize * 3, captureFile);
+    writtenCaptureFrames++;
+}
+
+// Compare frame with golden image or create it if it does not exist
+void compareWithGolden(Uint8 *frame) {
+    // Convert into top-down RGB
+    Uint8 *rgb = capturePlanes;
+    for (int y = 0; y < screenHeight; y++) {
+        Uint8 *pixel = frame + (screenHeight - 1 - y) * screenWidth * 4;
+        for (int x = 0; x < screenWidth; x++, pixel += 4) {
+            rgb[(y * screenWidth + x) * 3] = pixel[2];
+            rgb[(y * screenWidth + x) * 3 + 1] = pixel[1];
+            rgb[(y * screenWidth + x) * 3 + 2] = pixel[0];
+        }
+    }
+    
+    // Read golden image
+    FILE *golden = fopen(goldenFileName, "rb");
+    if (golden == NULL) {
+        golden = fopen(goldenFileName, "wb");
+        if (golden == NULL) {
+            printf("Cannot create golden image: \"%s\"\n", goldenFileName);
+            exitCode = 1;
+            return;
+        }
+        fprintf(golden, "P6\n%d %d\n255\n", screenWidth, screenHeight);
+        fwrite(rgb, 1, screenWidth * screenHeight * 3, golden);
+        fclose(golden);
+        printf("Golden image created: \"%s\"\n", goldenFileName);
+        return;
+    }
+    int width = 0;
+    int height = 0;
+    int maxValue = 0;
+    if (fscanf(golden, "P6 %d %d %d", &width, &height, &maxValue) != 3 || width != screenWidth || height != screenHeight || maxValue != 255) {
+        printf("Golden image has wrong format: \"%s\"\n", goldenFileName);
+        fclose(golden);
+        exitCode = 1;
+        return;
+    }
+    fgetc(golden);
+    
+    // Count pixels which differ too much
+    int differentPixels = 0;
+    Uint8 expected[3];
+    for (int i = 0; i < screenWidth * screenHeight; i++) {
+        if (fread(expected, 1, 3, golden) != 3) {
+            differentPixels += screenWidth * screenHeight - i;
+            break;
+        }
+        for (int c = 0; c < 3; c++) {
+            if (abs(expected[c] - rgb[i * 3 + c]) > goldenTolerance) {
+                differentPixels++;
+                break;
+            }
+        }
+    }
+    fclose(golden);
+    
+    printf("Golden image comparison: %d different pixels\n", differentPixels);
+    if (differentPixels > 0) {
+        exitCode = 1;
+    }
+}
+
+// Draw single wall
+void drawSigleWall(float x1, float y1, float x2, float y2) {
+    // Depth pass does not need textures
+    if (!depthOnlyPass) {
+        // Choose texture to draw
+        glBindTexture(GL_TEXTURE_2D, readTextures[0]);
+        
+        // Setup texture settings
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        
+        // Enable using texture
+        glEnable(GL_TEXTURE_2D);
+    }
     
     // Setup color
     glColor4f(1.0, 1.0, 1.0, 1.0);
@@ -616,15 +1794,18 @@ void drawDoubleWall(float x, float y, int drawingMode) {
 
 // Draw single door
 void drawSingleDoor(float x1, float y1, float x2, float y2) {
-    // Choose texture to draw
-    glBindTexture(GL_TEXTURE_2D, readTextures[1]);
-    
-    // Setup textures
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    // Enable using texture
-    glEnable(GL_TEXTURE_2D);
+    // Depth pass does not need textures
+    if (!depthOnlyPass) {
+        // Choose texture to draw
+        glBindTexture(GL_TEXTURE_2D, readTextures[1]);
+        
+        // Setup textures
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        
+        // Enable using texture
+        glEnable(GL_TEXTURE_2D);
+    }
     
     // Choose color
     glColor4f(1.0, 1.0, 1.0, 1.0);
@@ -715,6 +1896,39 @@ SDL_Surface* trimTexture(SDL_Surface* texture, int x, int y, int width, int heig
     return newTexture;
 }
 
+// Set pixel color in texture
+void setPixelColor(SDL_Surface *texture, int x, int y, Uint32 color)
+{
+    int bpp = texture->format->BytesPerPixel;
+    Uint8 *ptr = (Uint8 *)texture->pixels + y * texture->pitch + x * bpp;
+    
+    switch (bpp) {
+        case 1:
+            *ptr = color;
+            break;
+            
+        case 2:
+            *(Uint16 *)ptr = color;
+            break;
+            
+        case 3:
+            if (SDL_BYTEORDER == SDL_BIG_ENDIAN) {
+                ptr[0] = (color >> 16) & 0xFF;
+                ptr[1] = (color >> 8) & 0xFF;
+                ptr[2] = color & 0xFF;
+            } else {
+                ptr[0] = color & 0xFF;
+                ptr[1] = (color >> 8) & 0xFF;
+                ptr[2] = (color >> 16) & 0xFF;
+            }
+            break;
+            
+        case 4:
+            *(Uint32 *)ptr = color;
+            break;
+    }
+}
+
 // Get pixel color from texture
 Uint32 getPixelColor(SDL_Surface *texture, int x, int y)
 {